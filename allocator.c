@@ -1,29 +1,173 @@
+#if defined(__linux__)
+#define _GNU_SOURCE
+#elif defined(__unix__) || defined(__APPLE__)
+#define _DEFAULT_SOURCE
+#endif
 #include "allocator.h"
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef ENJ_HAVE_MMAP
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <stdint.h>
+#endif
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+/*Transparent huge page size, used for alignment*/
+#define HUGEPAGE_SIZE ((size_t)2 << 20)
+#endif
 
 /*ALIGN_SIZE must be a power of 2*/
 #define ALIGN_SIZE 16
 #define ROUNDUP(n, m) (((n) + (m) - 1) / (m) * (m))
 #define ROUNDDOWN(n, m) ((n) / (m) * (m))
 #define ROUND_PTR(i) ROUNDUP(i, sizeof(void *))
+/*Pool chunks at least twice pointer size for pointer alignment*/
+#define POOL_STRIDE(c) ((c) <= 2*sizeof(void *) ? ROUND_PTR(c) : (c))
+/*Ring records start with their size, low bit set once freed*/
+#define RING_HEADER ROUNDUP(sizeof(size_t), ALIGN_SIZE)
+#define WORD_BITS (sizeof(unsigned long) * CHAR_BIT)
+
+#if defined(__GLIBC__) || defined(__APPLE__)
+#include <execinfo.h>
+#define HAVE_BACKTRACE 1
+#endif
 
 static void * bump_acate(size_t size, void *data);
+static void * bump_zacate(size_t size, void *data);
 static void bump_decate(void *p, void *data);
 
 static void * stack_acate(size_t size, void *data);
+static void * stack_zacate(size_t size, void *data);
 static void stack_decate(void *p, void *data);
 
+#ifdef ENJ_HAVE_MMAP
+static void * vbump_acate(size_t size, void *data);
+static void * vbump_zacate(size_t size, void *data);
+static void vstack_decate(void *p, void *data);
+#endif
+
+static void * ring_acate(size_t size, void *data);
+static void * ring_zacate(size_t size, void *data);
+static void ring_decate(void *p, void *data);
+
 static void * pool_acate(size_t size, void *data);
+static void * pool_zacate(size_t size, void *data);
 static void pool_decate(void *p, void *data);
 
+static void * bitpool_acate(size_t size, void *data);
+static void * bitpool_zacate(size_t size, void *data);
+static void bitpool_decate(void *p, void *data);
+
 static void * heap_acate(size_t size, void *data);
+static void * heap_zacate(size_t size, void *data);
 static void heap_decate(void *p, void *data);
 
+static void * buddy_acate(size_t size, void *data);
+static void * buddy_zacate(size_t size, void *data);
+static void buddy_decate(void *p, void *data);
+
+static void * prof_acate(size_t size, void *data);
+static void * prof_zacate(size_t size, void *data);
+static void prof_decate(void *p, void *data);
+
+/*Index of lowest set bit, w must be nonzero*/
+static size_t word_ctz(unsigned long w){
+#if defined(__GNUC__)
+    return (size_t)__builtin_ctzl(w);
+#else
+    size_t n = 0;
+    size_t shift = WORD_BITS / 2;
+    while(shift){
+        if(!(w & ((1UL << shift) - 1))){
+            w >>= shift;
+            n += shift;
+        }
+        shift >>= 1;
+    }
+    return n;
+#endif
+}
+
 void * Enj_Alloc(Enj_Allocator *a, size_t size){
     return (*a->alloc)(size, a->data);
 }
 void Enj_Free(Enj_Allocator *a, void *p){
     (*a->dealloc)(p, a->data);
 }
+void * Enj_Calloc(Enj_Allocator *a, size_t size){
+    void *res;
+
+    /*Allocators from this file know which memory is still zero*/
+    if(a->alloc == &bump_acate) return bump_zacate(size, a->data);
+    if(a->alloc == &stack_acate) return stack_zacate(size, a->data);
+#ifdef ENJ_HAVE_MMAP
+    if(a->alloc == &vbump_acate) return vbump_zacate(size, a->data);
+#endif
+    if(a->alloc == &ring_acate) return ring_zacate(size, a->data);
+    if(a->alloc == &pool_acate) return pool_zacate(size, a->data);
+    if(a->alloc == &bitpool_acate) return bitpool_zacate(size, a->data);
+    if(a->alloc == &heap_acate) return heap_zacate(size, a->data);
+    if(a->alloc == &buddy_acate) return buddy_zacate(size, a->data);
+    if(a->alloc == &prof_acate) return prof_zacate(size, a->data);
+
+    res = (*a->alloc)(size, a->data);
+    if(res) memset(res, 0, size);
+    return res;
+}
+void Enj_MarkZeroed(Enj_Allocator *a){
+    if(a->alloc == &bump_acate){
+        Enj_BumpAllocatorData *d = (Enj_BumpAllocatorData *)a->data;
+        d->fresh = d->start;
+    }
+    else if(a->alloc == &stack_acate){
+        Enj_StackAllocatorData *d = (Enj_StackAllocatorData *)a->data;
+        d->fresh = d->start;
+    }
+#ifdef ENJ_HAVE_MMAP
+    else if(a->alloc == &vbump_acate){
+        Enj_VirtualAllocatorData *d = (Enj_VirtualAllocatorData *)a->data;
+        d->fresh = d->start;
+    }
+#endif
+    else if(a->alloc == &ring_acate){
+        Enj_RingAllocatorData *d = (Enj_RingAllocatorData *)a->data;
+        d->fresh = d->start;
+    }
+    else if(a->alloc == &pool_acate){
+        Enj_PoolAllocatorData *d = (Enj_PoolAllocatorData *)a->data;
+        d->fresh = d->start;
+    }
+    else if(a->alloc == &bitpool_acate){
+        Enj_BitmapPoolAllocatorData *d = (Enj_BitmapPoolAllocatorData *)a->data;
+        d->fresh = d->start;
+    }
+    else if(a->alloc == &heap_acate){
+        Enj_HeapAllocatorData *d = (Enj_HeapAllocatorData *)a->data;
+        d->fresh = d->start;
+    }
+    else if(a->alloc == &buddy_acate){
+        Enj_BuddyAllocatorData *d = (Enj_BuddyAllocatorData *)a->data;
+        d->fresh = d->base;
+    }
+    else if(a->alloc == &prof_acate){
+        Enj_MarkZeroed(((Enj_ProfilerData *)a->data)->backing);
+    }
+}
+
+/*Clear the part of p that lies below fresh, the rest is still zero*/
+static void clear_used(void *p, size_t size, void *fresh){
+    if((char *)p + size <= (char *)fresh) memset(p, 0, size);
+    else if((char *)p < (char *)fresh){
+        memset(p, 0, (size_t)((char *)fresh - (char *)p));
+    }
+}
 
 void Enj_InitBumpAllocator(
     Enj_Allocator *a,
@@ -36,6 +180,7 @@ void Enj_InitBumpAllocator(
     d->start = buffer;
     d->size = size;
     d->head = buffer;
+    d->fresh = (char *)buffer + size;
 }
 
 void Enj_InitStackAllocator(
@@ -49,6 +194,149 @@ void Enj_InitStackAllocator(
     d->start = buffer;
     d->size = size;
     d->head = buffer;
+    d->fresh = (char *)buffer + size;
+}
+
+#ifdef ENJ_HAVE_MMAP
+static void virtual_init(
+    Enj_VirtualAllocatorData *d,
+    size_t size,
+    size_t commitsize,
+    int flags){
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t align = page;
+    size_t extra;
+    char *base;
+    char *start;
+
+    if(flags & ENJ_VIRTUAL_HUGEPAGES) align = HUGEPAGE_SIZE;
+    if(!commitsize) commitsize = align;
+    commitsize = ROUNDUP(commitsize, align);
+    size = ROUNDUP(size, commitsize);
+
+    d->start = NULL;
+    d->size = 0;
+    d->head = NULL;
+    d->committed = NULL;
+    d->commitsize = commitsize;
+    d->flags = flags;
+    d->fresh = NULL;
+
+    /*Over-reserve so start can be aligned for huge pages*/
+    extra = align > page ? align : 0;
+    base = (char *)mmap(NULL, size + extra, PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(base == (char *)MAP_FAILED) return;
+
+    start = base + (ROUNDUP((size_t)base, align) - (size_t)base);
+    if(start > base) munmap(base, start - base);
+    if(start + size < base + size + extra){
+        munmap(start + size, base + size + extra - (start + size));
+    }
+
+#ifdef MADV_HUGEPAGE
+    if(flags & ENJ_VIRTUAL_HUGEPAGES) madvise(start, size, MADV_HUGEPAGE);
+#endif
+
+    d->start = start;
+    d->size = size;
+    d->head = start;
+    d->committed = start;
+    /*Anonymous pages start out zero*/
+    d->fresh = start;
+}
+
+/*Make pages up to end usable, rounded to commitsize, 0 on success*/
+static int virtual_commit(Enj_VirtualAllocatorData *d, char *end){
+    char *newcommit = (char *)d->start
+        + ROUNDUP((size_t)(end - (char *)d->start), d->commitsize);
+
+    if(mprotect(d->committed, newcommit - (char *)d->committed,
+        PROT_READ | PROT_WRITE)) return -1;
+
+    d->committed = newcommit;
+    return 0;
+}
+
+/*Give back committed pages from keep up*/
+static void virtual_decommit(Enj_VirtualAllocatorData *d, char *keep){
+    if(keep >= (char *)d->committed) return;
+
+#ifdef __linux__
+    /*Dropping the pages in place keeps the mapping and its advice*/
+    if(madvise(keep, (char *)d->committed - keep, MADV_DONTNEED)) return;
+    if(mprotect(keep, (char *)d->committed - keep, PROT_NONE)) return;
+#else
+    /*Mapping fresh PROT_NONE pages over the range discards the old ones*/
+    if(mmap(keep, (char *)d->committed - keep, PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) return;
+#ifdef MADV_HUGEPAGE
+    /*The new mapping does not inherit the old advice*/
+    if(d->flags & ENJ_VIRTUAL_HUGEPAGES){
+        madvise(keep, (char *)d->committed - keep, MADV_HUGEPAGE);
+    }
+#endif
+#endif
+
+    d->committed = keep;
+    /*Remapped pages read as zero again*/
+    if((char *)d->fresh > keep) d->fresh = keep;
+}
+
+void Enj_InitVirtualBumpAllocator(
+    Enj_Allocator *a,
+    Enj_VirtualAllocatorData *d,
+    size_t size,
+    size_t commitsize,
+    int flags){
+    a->alloc = &vbump_acate;
+    a->dealloc = &bump_decate;
+    a->data = d;
+    virtual_init(d, size, commitsize, flags);
+}
+
+void Enj_InitVirtualStackAllocator(
+    Enj_Allocator *a,
+    Enj_VirtualAllocatorData *d,
+    size_t size,
+    size_t commitsize,
+    int flags){
+    a->alloc = &vbump_acate;
+    a->dealloc = &vstack_decate;
+    a->data = d;
+    virtual_init(d, size, commitsize, flags);
+}
+
+void Enj_ResetVirtualAllocator(Enj_VirtualAllocatorData *d){
+    d->head = d->start;
+    virtual_decommit(d, (char *)d->start);
+}
+
+void Enj_DestroyVirtualAllocator(Enj_VirtualAllocatorData *d){
+    if(d->start) munmap(d->start, d->size);
+
+    d->start = NULL;
+    d->size = 0;
+    d->head = NULL;
+    d->committed = NULL;
+    d->fresh = NULL;
+}
+#endif
+
+void Enj_InitRingAllocator(
+    Enj_Allocator *a,
+    Enj_RingAllocatorData *d,
+    void *buffer,
+    size_t size){
+    a->alloc = &ring_acate;
+    a->dealloc = &ring_decate;
+    a->data = d;
+    d->start = buffer;
+    d->size = ROUNDDOWN(size, ALIGN_SIZE);
+    d->head = buffer;
+    d->tail = buffer;
+    d->fresh = (char *)buffer + size;
 }
 
 void Enj_InitPoolAllocator(
@@ -58,44 +346,86 @@ void Enj_InitPoolAllocator(
     size_t size,
     size_t chunksize){
 
-    size_t align;
-
-    char *i;
-    char *end;
-
     a->alloc = &pool_acate;
     a->dealloc = &pool_decate;
     a->data = d;
 
-    /*chunksize at least twice pointer size for pointer alignment*/
-    align = chunksize <= 2*sizeof(void *) ?
-        ROUND_PTR(chunksize) :
-        chunksize;
+    d->start = buffer;
+    d->size = size;
+    d->chunksize = chunksize;
+
+    /*Chunks are carved on demand, so init never touches the buffer*/
+    d->free = NULL;
+    d->carve = buffer;
+    d->fresh = (char *)buffer + size;
+}
+
+void Enj_InitBitmapPoolAllocator(
+    Enj_Allocator *a,
+    Enj_BitmapPoolAllocatorData *d,
+    void *buffer,
+    size_t size,
+    size_t chunksize){
+
+    size_t words;
+    size_t mapsize;
+    size_t i;
+
+    a->alloc = &bitpool_acate;
+    a->dealloc = &bitpool_decate;
+    a->data = d;
 
     d->start = buffer;
     d->size = size;
     d->chunksize = chunksize;
+    d->bitmap = (unsigned long *)buffer;
+    d->count = 0;
+    d->hint = 0;
+    d->fresh = (char *)buffer + size;
 
-    d->free = buffer;
-    /*If no room for a single chunk, edge case*/
-    if(align > d->size){
-        d->free = NULL;
-        return;
-    }
+    if(!chunksize) return;
+
+    /*Bitmap for every chunk that could fit, plus a word of alignment slack*/
+    mapsize = (ROUNDUP(size / chunksize, WORD_BITS) / WORD_BITS + 1)
+        * sizeof(unsigned long);
+    if(mapsize >= size) return;
+
+    d->count = (size - mapsize) / chunksize;
+    d->bitmap = (unsigned long *)((char *)buffer
+        + ROUNDUP(d->count * chunksize, sizeof(unsigned long)));
 
-    /*Initialize pool chunks*/
-    i = (char *)d->free;
-    end = (char *)d->start + d->size - align*2;
-    /*Iterate over all chunks, adding the next one to free list*/
-    /*Pointer is aligned in chunk by rounding up*/
-    while(i <= end){
-        *(void **)((char *)d->free + ROUND_PTR(i-(char *)d->free))
-            = (void *)(i + align);
-        i = i + align;
+    words = ROUNDUP(d->count, WORD_BITS) / WORD_BITS;
+    for(i = 0; i < words; i++){
+        d->bitmap[i] = 0;
     }
-    /*Last element in pool points to NULL to end the list*/
-    *(void **)i = NULL;
+    /*Mark bits past the last chunk as live so they are never handed out*/
+    if(d->count % WORD_BITS){
+        d->bitmap[words - 1] = ~0UL << (d->count % WORD_BITS);
+    }
+}
+
+void Enj_PoolForEachLive(
+    Enj_BitmapPoolAllocatorData *d,
+    void (*fn)(void *, void *),
+    void *ctx){
 
+    size_t words = ROUNDUP(d->count, WORD_BITS) / WORD_BITS;
+    size_t i;
+
+    for(i = 0; i < words; i++){
+        unsigned long w = d->bitmap[i];
+
+        /*Skip padding bits of the last word*/
+        if((i == words - 1) & (d->count % WORD_BITS != 0)){
+            w &= ~(~0UL << (d->count % WORD_BITS));
+        }
+        /*Word is copied first, so fn freeing its chunk is harmless*/
+        while(w){
+            size_t bit = word_ctz(w);
+            w &= w - 1;
+            (*fn)((char *)d->start + (i*WORD_BITS + bit) * d->chunksize, ctx);
+        }
+    }
 }
 
 typedef struct heap_header{
@@ -133,6 +463,7 @@ void Enj_InitHeapAllocator(
 
     d->start = buffer;
     d->size = size;
+    d->fresh = (char *)buffer + size;
 
     space = ROUNDDOWN(size, ALIGN_SIZE);
     /*Stop if not enough space*/
@@ -187,6 +518,7 @@ static void * bump_acate(size_t size, void *data){
 
     res = stack->head;
     stack->head = (void *)((char *)stack->head + roundupsize);
+    if((char *)stack->head > (char *)stack->fresh) stack->fresh = stack->head;
 
     return res;
 }
@@ -195,6 +527,13 @@ static void bump_decate(void *p, void *data){
     /*Do nothing, not supposed to deallocate individual chunks.*/
     return;
 }
+static void * bump_zacate(size_t size, void *data){
+    void *fresh = ((Enj_BumpAllocatorData *)data)->fresh;
+    void *res = bump_acate(size, data);
+
+    if(res) clear_used(res, size, fresh);
+    return res;
+}
 
 static void * stack_acate(size_t size, void *data){
     Enj_StackAllocatorData *stack = (Enj_StackAllocatorData *)data;
@@ -212,6 +551,7 @@ static void * stack_acate(size_t size, void *data){
 
     res = stack->head;
     stack->head = (void *)((char *)stack->head + roundupsize);
+    if((char *)stack->head > (char *)stack->fresh) stack->fresh = stack->head;
 
     return res;
 }
@@ -223,20 +563,160 @@ static void stack_decate(void *p, void *data){
     stack = (Enj_StackAllocatorData *)data;
     stack->head = p;
 }
+static void * stack_zacate(size_t size, void *data){
+    void *fresh = ((Enj_StackAllocatorData *)data)->fresh;
+    void *res = stack_acate(size, data);
+
+    if(res) clear_used(res, size, fresh);
+    return res;
+}
+
+#ifdef ENJ_HAVE_MMAP
+static void * vbump_acate(size_t size, void *data){
+    Enj_VirtualAllocatorData *stack = (Enj_VirtualAllocatorData *)data;
+
+    /*Round up added size*/
+    size_t roundupsize = (size + ALIGN_SIZE - 1) / ALIGN_SIZE * ALIGN_SIZE;
+
+    void *res;
+
+    /*Check if enough room, also fails if reservation failed*/
+    if(roundupsize > stack->size
+    - (size_t)((char *)stack->head - (char *)stack->start)){
+        return NULL;
+    }
+
+    /*Commit more pages if needed*/
+    if((char *)stack->head + roundupsize > (char *)stack->committed
+    && virtual_commit(stack, (char *)stack->head + roundupsize)){
+        return NULL;
+    }
+
+    res = stack->head;
+    stack->head = (void *)((char *)stack->head + roundupsize);
+    if((char *)stack->head > (char *)stack->fresh) stack->fresh = stack->head;
+
+    return res;
+}
+
+static void vstack_decate(void *p, void *data){
+    Enj_VirtualAllocatorData *stack;
+    char *keep;
+
+    if (!p) return;
+
+    stack = (Enj_VirtualAllocatorData *)data;
+    stack->head = p;
+
+    /*Keep one commitsize of slack past the next boundary so a stack*/
+    /*bouncing over it does not thrash*/
+    keep = (char *)stack->start
+        + ROUNDUP((size_t)((char *)p - (char *)stack->start), stack->commitsize)
+        + stack->commitsize;
+    if(keep + stack->commitsize <= (char *)stack->committed){
+        virtual_decommit(stack, keep);
+    }
+}
+static void * vbump_zacate(size_t size, void *data){
+    void *fresh = ((Enj_VirtualAllocatorData *)data)->fresh;
+    void *res = vbump_acate(size, data);
+
+    if(res) clear_used(res, size, fresh);
+    return res;
+}
+#endif
+
+static void * ring_acate(size_t size, void *data){
+    Enj_RingAllocatorData *ring = (Enj_RingAllocatorData *)data;
+
+    char *start = (char *)ring->start;
+    char *end = start + ring->size;
+    char *head = (char *)ring->head;
+    char *tail = (char *)ring->tail;
+
+    size_t need = ROUNDUP(size, ALIGN_SIZE) + RING_HEADER;
+
+    /*Restart empty ring at the beginning for the most contiguous room,*/
+    /*only kept if the allocation succeeds*/
+    if(head == tail){
+        head = start;
+        tail = start;
+    }
+
+    /*Head never catches up to tail, equal means empty*/
+    if(head >= tail){
+        if(need > (size_t)(end - head)){
+            /*Wrap around, padding the end with a freed record*/
+            if(need >= (size_t)(tail - start)) return NULL;
+            if(head != end){
+                *(size_t *)head = (size_t)(end - head) | 1;
+                if(head + RING_HEADER > (char *)ring->fresh){
+                    ring->fresh = head + RING_HEADER;
+                }
+            }
+            head = start;
+        }
+    }
+    else if(need >= (size_t)(tail - head)){
+        return NULL;
+    }
+
+    *(size_t *)head = need;
+    ring->head = head + need;
+    ring->tail = tail;
+    if((char *)ring->head > (char *)ring->fresh) ring->fresh = ring->head;
+
+    return head + RING_HEADER;
+}
+static void ring_decate(void *p, void *data){
+    Enj_RingAllocatorData *ring;
+
+    if (!p) return;
+
+    ring = (Enj_RingAllocatorData *)data;
+    *(size_t *)((char *)p - RING_HEADER) |= 1;
+
+    /*Advance tail over every freed record*/
+    while(ring->tail != ring->head && (*(size_t *)ring->tail & 1)){
+        char *next = (char *)ring->tail + (*(size_t *)ring->tail & ~(size_t)1);
+        if((next == (char *)ring->start + ring->size) & (next != ring->head)){
+            next = (char *)ring->start;
+        }
+        ring->tail = next;
+    }
+}
+static void * ring_zacate(size_t size, void *data){
+    void *fresh = ((Enj_RingAllocatorData *)data)->fresh;
+    void *res = ring_acate(size, data);
+
+    if(res) clear_used(res, size, fresh);
+    return res;
+}
 
 static void * pool_acate(size_t size, void *data){
     Enj_PoolAllocatorData *pool = (Enj_PoolAllocatorData *)data;
 
     void *res;
 
-    /*No more room*/
-    if((pool->chunksize != size) | (!pool->free)){
+    if(pool->chunksize != size) return NULL;
+
+    if(pool->free){
+        res = pool->free;
+        pool->free = *(void **)((char *)pool->start
+        + ROUND_PTR((char *)pool->free - (char *)pool->start));
+
+        return res;
+    }
+
+    /*Carve a chunk that was never handed out, if there is room*/
+    if((size_t)((char *)pool->start + pool->size - (char *)pool->carve)
+    < POOL_STRIDE(size)){
         return NULL;
     }
 
-    res = pool->free;
-    pool->free = *(void **)((char *)pool->start
-    + ROUND_PTR((char *)pool->free - (char *)pool->start));
+    res = pool->carve;
+    pool->carve = (void *)((char *)pool->carve + POOL_STRIDE(size));
+    if((char *)pool->carve > (char *)pool->fresh) pool->fresh = pool->carve;
 
     return res;
 }
@@ -251,7 +731,260 @@ static void pool_decate(void *p, void *data){
     + ROUND_PTR((char *)p - (char *)pool->start)) = pool->free;
     pool->free = p;
 }
+static void * pool_zacate(size_t size, void *data){
+    void *fresh = ((Enj_PoolAllocatorData *)data)->fresh;
+    void *res = pool_acate(size, data);
+
+    if(res) clear_used(res, size, fresh);
+    return res;
+}
+
+
+static void * bitpool_acate(size_t size, void *data){
+    Enj_BitmapPoolAllocatorData *pool = (Enj_BitmapPoolAllocatorData *)data;
+
+    size_t words;
+    size_t i;
+
+    if(pool->chunksize != size) return NULL;
+
+    words = ROUNDUP(pool->count, WORD_BITS) / WORD_BITS;
+    /*Scan a word at a time from the lowest word that may have room*/
+    for(i = pool->hint; i < words; i++){
+        unsigned long w = pool->bitmap[i];
+        if(~w){
+            size_t bit = word_ctz(~w);
+            char *res = (char *)pool->start
+                + (i*WORD_BITS + bit) * pool->chunksize;
+
+            pool->bitmap[i] = w | (1UL << bit);
+            pool->hint = i;
+            if(res + size > (char *)pool->fresh) pool->fresh = res + size;
+
+            return res;
+        }
+    }
+    pool->hint = words;
+
+    return NULL;
+}
+static void bitpool_decate(void *p, void *data){
+    Enj_BitmapPoolAllocatorData *pool;
+    size_t index;
+
+    if (!p) return;
+
+    pool = (Enj_BitmapPoolAllocatorData *)data;
+    index = (size_t)((char *)p - (char *)pool->start) / pool->chunksize;
+
+    pool->bitmap[index / WORD_BITS] &= ~(1UL << (index % WORD_BITS));
+    if(index / WORD_BITS < pool->hint) pool->hint = index / WORD_BITS;
+}
+static void * bitpool_zacate(size_t size, void *data){
+    void *fresh = ((Enj_BitmapPoolAllocatorData *)data)->fresh;
+    void *res = bitpool_acate(size, data);
+
+    if(res) clear_used(res, size, fresh);
+    return res;
+}
+
+
+/*Buddy allocator*/
+
+struct buddy_free;
+typedef struct buddy_free buddy_free;
+struct buddy_free{
+    buddy_free *prev;
+    buddy_free *next;
+};
+
+#define BUDDY_BIT(d, k, unit) ((d)->bitoffset[k] + ((unit) >> (k)))
+
+static void buddy_push(Enj_BuddyAllocatorData *buddy, size_t unit, int k){
+    buddy_free *b = (buddy_free *)((char *)buddy->base
+        + (unit << buddy->shift));
+    size_t bit = BUDDY_BIT(buddy, k, unit);
+
+    b->prev = NULL;
+    b->next = (buddy_free *)buddy->free[k];
+    if(b->next) b->next->prev = b;
+    buddy->free[k] = b;
+
+    buddy->bitmap[bit / WORD_BITS] |= 1UL << (bit % WORD_BITS);
+    buddy->avail |= 1UL << k;
+}
+
+static void buddy_unlink(
+    Enj_BuddyAllocatorData *buddy, buddy_free *b, size_t unit, int k){
+    size_t bit = BUDDY_BIT(buddy, k, unit);
+
+    if(b->prev) b->prev->next = b->next;
+    else buddy->free[k] = b->next;
+    if(b->next) b->next->prev = b->prev;
+
+    buddy->bitmap[bit / WORD_BITS] &= ~(1UL << (bit % WORD_BITS));
+    if(!buddy->free[k]) buddy->avail &= ~(1UL << k);
+}
+
+void Enj_InitBuddyAllocator(
+    Enj_Allocator *a,
+    Enj_BuddyAllocatorData *d,
+    void *buffer,
+    size_t size,
+    size_t minsize){
+
+    size_t meta;
+    size_t words;
+    size_t unit;
+    size_t i;
+    int k;
+
+    a->alloc = &buddy_acate;
+    a->dealloc = &buddy_decate;
+    a->data = d;
+
+    /*Free blocks hold two list pointers*/
+    if(minsize < ALIGN_SIZE) minsize = ALIGN_SIZE;
+    if(minsize < sizeof(buddy_free)) minsize = sizeof(buddy_free);
+    d->shift = 0;
+    while(((size_t)1 << d->shift) < minsize) d->shift++;
+    minsize = (size_t)1 << d->shift;
+
+    d->start = buffer;
+    d->size = size;
+    d->minsize = minsize;
+    d->base = buffer;
+    d->units = 0;
+    d->orders = 0;
+    d->order = (unsigned char *)buffer;
+    d->bitmap = (unsigned long *)buffer;
+    d->avail = 0;
+    d->fresh = (char *)buffer + size;
+    for(k = 0; k < ENJ_BUDDY_ORDERS; k++){
+        d->bitoffset[k] = 0;
+        d->free[k] = NULL;
+    }
+
+    /*Metadata bound for every unit that could fit, at most 2 bits and*/
+    /*an order byte per unit, plus alignment slack*/
+    i = size / minsize;
+    meta = ROUNDUP(2*i + ENJ_BUDDY_ORDERS, WORD_BITS) / WORD_BITS
+        * sizeof(unsigned long) + i + ALIGN_SIZE;
+    if(meta >= size) return;
+    d->units = (size - meta) / minsize;
+    if(!d->units) return;
+
+    while(d->orders < ENJ_BUDDY_ORDERS
+    && ((size_t)1 << d->orders) <= d->units){
+        if(d->orders){
+            d->bitoffset[d->orders] = d->bitoffset[d->orders - 1]
+                + (d->units >> (d->orders - 1));
+        }
+        d->orders++;
+    }
+
+    /*Bitmap first for word alignment, then order bytes, then blocks*/
+    words = ROUNDUP(d->bitoffset[d->orders - 1]
+        + (d->units >> (d->orders - 1)), WORD_BITS) / WORD_BITS;
+    for(i = 0; i < words; i++){
+        d->bitmap[i] = 0;
+    }
+    d->order = (unsigned char *)(d->bitmap + words);
+    d->base = (char *)buffer
+        + ROUNDUP(words * sizeof(unsigned long) + d->units, ALIGN_SIZE);
+
+    /*Carve largest blocks first, leftovers have no buddy in range*/
+    unit = 0;
+    for(k = d->orders - 1; k >= 0; k--){
+        while(unit + ((size_t)1 << k) <= d->units){
+            buddy_push(d, unit, k);
+            unit += (size_t)1 << k;
+        }
+    }
+}
+
+static void * buddy_acate(size_t size, void *data){
+    Enj_BuddyAllocatorData *buddy = (Enj_BuddyAllocatorData *)data;
 
+    unsigned long fits;
+    buddy_free *b;
+    size_t unit;
+    int k;
+    int j;
+
+    if(!buddy->orders
+    || size > buddy->minsize << (buddy->orders - 1)) return NULL;
+
+    k = 0;
+    while((buddy->minsize << k) < size) k++;
+
+    /*Smallest non-empty order that fits*/
+    fits = buddy->avail & (~0UL << k);
+    if(!fits) return NULL;
+    j = (int)word_ctz(fits);
+
+    b = (buddy_free *)buddy->free[j];
+    unit = (size_t)((char *)b - (char *)buddy->base) >> buddy->shift;
+    buddy_unlink(buddy, b, unit, j);
+
+    /*Split, returning upper halves to their free lists*/
+    while(j > k){
+        j--;
+        buddy_push(buddy, unit + ((size_t)1 << j), j);
+    }
+    buddy->order[unit] = (unsigned char)k;
+    if((char *)b + (buddy->minsize << k) > (char *)buddy->fresh){
+        buddy->fresh = (char *)b + (buddy->minsize << k);
+    }
+
+    return b;
+}
+static void buddy_decate(void *p, void *data){
+    Enj_BuddyAllocatorData *buddy;
+    buddy_free *b;
+    size_t unit;
+    int k;
+
+    if (!p) return;
+
+    buddy = (Enj_BuddyAllocatorData *)data;
+    unit = (size_t)((char *)p - (char *)buddy->base) >> buddy->shift;
+    k = buddy->order[unit];
+
+    /*Merge while the buddy is in range and free at the same order*/
+    while(k < buddy->orders - 1){
+        size_t other = unit ^ ((size_t)1 << k);
+        size_t bit = BUDDY_BIT(buddy, k, other);
+
+        if(other + ((size_t)1 << k) > buddy->units) break;
+        if(!(buddy->bitmap[bit / WORD_BITS] & (1UL << (bit % WORD_BITS)))){
+            break;
+        }
+
+        b = (buddy_free *)((char *)buddy->base + (other << buddy->shift));
+        buddy_unlink(buddy, b, other, k);
+        /*Upper buddy links end up inside the merged block, keep*/
+        /*memory past fresh zero*/
+        if((other > unit) & ((char *)(b + 1) > (char *)buddy->fresh)){
+            memset(b, 0, sizeof(buddy_free));
+        }
+        unit &= ~((size_t)1 << k);
+        k++;
+    }
+
+    buddy_push(buddy, unit, k);
+}
+static void * buddy_zacate(size_t size, void *data){
+    void *fresh = ((Enj_BuddyAllocatorData *)data)->fresh;
+    void *res = buddy_acate(size, data);
+
+    if(res){
+        clear_used(res, size, fresh);
+        /*Free list links are written even into fresh blocks*/
+        memset(res, 0, sizeof(buddy_free) < size ? sizeof(buddy_free) : size);
+    }
+    return res;
+}
 
 
 /*RB Tree and heap stuff*/
@@ -703,6 +1436,9 @@ static void * heap_acate(size_t size, void *data){
     }
     /*Set block to allocated*/
     head->prev_alloc |= 1;
+    if((char *)head + (head->next_color & ~1) > (char *)heap->fresh){
+        heap->fresh = (char *)head + (head->next_color & ~1);
+    }
 
     return res;
 
@@ -731,6 +1467,11 @@ static void heap_decate(void *p, void *data){
         oldn = (heap_header *)
             ((char *)oldfree + (oldfree->header.next_color & ~1));
         oldn->prev_alloc += oldfree->header.prev_alloc & ~1;
+        /*oldfree links end up inside the merged block, keep*/
+        /*memory past fresh zero*/
+        if((char *)(oldfree + 1) > (char *)heap->fresh){
+            memset(oldfree, 0, sizeof(heap_free));
+        }
     }
     /*Check if previous block is free to merge*/
 
@@ -755,3 +1496,560 @@ static void heap_decate(void *p, void *data){
     insertfree(heap, newfree);
     return;
 }
+static void * heap_zacate(size_t size, void *data){
+    void *fresh = ((Enj_HeapAllocatorData *)data)->fresh;
+    void *res = heap_acate(size, data);
+    size_t links =
+        sizeof(heap_free) - ROUNDUP(sizeof(heap_header), ALIGN_SIZE);
+
+    if(res){
+        clear_used(res, size, fresh);
+        /*Tree links are written even into fresh blocks*/
+        memset(res, 0, links < size ? links : size);
+    }
+    return res;
+}
+
+
+
+/*Sampling profiler*/
+
+static size_t prof_hash(void *p, size_t capacity){
+    return (size_t)p / ALIGN_SIZE * 2654435761u % capacity;
+}
+
+/*Bytes until next sample, exponentially distributed around rate*/
+/*Sampling by bytes this way picks each byte with equal chance*/
+static size_t prof_next(Enj_ProfilerData *prof){
+    unsigned long x = prof->rng;
+    unsigned long r;
+    int e;
+    double f;
+    double lg;
+
+    if(!prof->rate) return (size_t)-1;
+
+    /*32 bit xorshift*/
+    x ^= (x << 13) & 0xffffffffUL;
+    x ^= x >> 17;
+    x ^= (x << 5) & 0xffffffffUL;
+    prof->rng = x;
+
+    /*Uniform r in [1, 2^24], -ln(r/2^24) through approximate log2*/
+    r = (x >> 8) + 1;
+    e = 0;
+    while(r >> (e + 1)) e++;
+    f = (double)r / (double)(1UL << e) - 1.0;
+    lg = e + f * (4.0/3.0 - f/3.0);
+
+    return (size_t)((24.0 - lg) * 0.6931471805599453 * (double)prof->rate) + 1;
+}
+
+static void prof_record(
+    Enj_ProfilerData *prof, void *p, size_t size, int skip){
+
+    Enj_ProfileSample *s;
+    size_t i;
+
+    /*Keep table at most three quarters full so probes stay short*/
+    if((prof->live + 1) * 4 > prof->capacity * 3) return;
+
+    i = prof_hash(p, prof->capacity);
+    while(prof->samples[i].p && prof->samples[i].p != p){
+        i = (i + 1) % prof->capacity;
+    }
+    s = &prof->samples[i];
+    /*Same address again means the backing allocator freed it implicitly*/
+    if(!s->p) prof->live++;
+
+    s->p = p;
+    s->size = size;
+    s->depth = 0;
+#ifdef HAVE_BACKTRACE
+    {
+        void *frames[2 * ENJ_PROFILE_DEPTH];
+        int n = backtrace(frames, ENJ_PROFILE_DEPTH + skip);
+        int j;
+        for(j = skip; j < n; j++){
+            s->stack[j - skip] = frames[j];
+        }
+        s->depth = n > skip ? n - skip : 0;
+    }
+#else
+    (void)skip;
+#endif
+}
+
+/*Count size towards the next sample, recording res once it is reached*/
+static void prof_sample(
+    Enj_ProfilerData *prof, void *res, size_t size, int skip){
+
+    /*Fast path, a subtraction until the sampling point is crossed*/
+    if(size < prof->countdown){
+        prof->countdown -= size;
+        return;
+    }
+
+    if(res) prof_record(prof, res, size, skip);
+    prof->countdown = prof_next(prof);
+}
+
+static void prof_forget(Enj_ProfilerData *prof, void *p){
+    size_t i = prof_hash(p, prof->capacity);
+    size_t j;
+
+    while(prof->samples[i].p != p){
+        if(!prof->samples[i].p) return;
+        i = (i + 1) % prof->capacity;
+    }
+
+    /*Shift later entries of the probe run back over the hole*/
+    j = i;
+    for(;;){
+        size_t home;
+
+        j = (j + 1) % prof->capacity;
+        if(!prof->samples[j].p) break;
+
+        home = prof_hash(prof->samples[j].p, prof->capacity);
+        if(i <= j ? (home <= i) | (home > j) : (home <= i) & (home > j)){
+            prof->samples[i] = prof->samples[j];
+            i = j;
+        }
+    }
+    prof->samples[i].p = NULL;
+    prof->live--;
+}
+
+#ifdef HAVE_BACKTRACE
+/*Backing used while calibrating, hands out one recognizable block*/
+static char prof_probe_block;
+static void * prof_probe_acate(size_t size, void *data){
+    (void)size;
+    (void)data;
+    return &prof_probe_block;
+}
+static void prof_probe_decate(void *p, void *data){
+    (void)p;
+    (void)data;
+}
+
+/*Frames to drop so stacks start at the caller of Enj_Alloc, or of*/
+/*Enj_Calloc when zeroed. Measured by sampling a call from here, as*/
+/*inlining and tail calls decide whether Enj_Alloc keeps a frame*/
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+static int prof_calibrate(Enj_Allocator *a, int zeroed){
+    Enj_ProfilerData *prof = (Enj_ProfilerData *)a->data;
+    Enj_Allocator *backing = prof->backing;
+    Enj_Allocator probe;
+    Enj_ProfileSample *s = NULL;
+    void *here[2];
+    int skip = 0;
+    size_t i;
+
+    /*here[1] is where this returns to, one frame above the sampled call*/
+    if(backtrace(here, 2) < 2) return 0;
+
+    probe.alloc = &prof_probe_acate;
+    probe.dealloc = &prof_probe_decate;
+    probe.data = NULL;
+    prof->backing = &probe;
+    prof->countdown = 0;
+
+    if(zeroed) Enj_Calloc(a, 0);
+    else Enj_Alloc(a, 0);
+
+    for(i = 0; i < prof->capacity; i++){
+        if(prof->samples[i].p == &prof_probe_block) s = &prof->samples[i];
+    }
+    if(s){
+        int j;
+        for(j = 1; j < s->depth; j++){
+            if(s->stack[j] == here[1]){
+                skip = j - 1;
+                break;
+            }
+        }
+        prof_forget(prof, &prof_probe_block);
+    }
+
+    prof->backing = backing;
+    return skip;
+}
+#endif
+
+void Enj_InitProfiler(
+    Enj_Allocator *a,
+    Enj_ProfilerData *d,
+    Enj_Allocator *backing,
+    Enj_ProfileSample *samples,
+    size_t capacity,
+    size_t rate){
+
+    size_t i;
+
+    a->alloc = &prof_acate;
+    a->dealloc = &prof_decate;
+    a->data = d;
+
+    d->backing = backing;
+    d->rng = (unsigned long)(size_t)d & 0xffffffffUL;
+    if(!d->rng) d->rng = 1;
+    d->samples = samples;
+    d->capacity = capacity;
+    d->live = 0;
+    for(i = 0; i < capacity; i++){
+        samples[i].p = NULL;
+    }
+
+    d->allocskip = 0;
+    d->callocskip = 0;
+#ifdef HAVE_BACKTRACE
+    d->allocskip = prof_calibrate(a, 0);
+    d->callocskip = prof_calibrate(a, 1);
+#endif
+
+    Enj_SetProfilerRate(d, rate);
+}
+
+void Enj_SetProfilerRate(Enj_ProfilerData *d, size_t rate){
+    d->rate = rate;
+    d->countdown = prof_next(d);
+}
+
+void Enj_DumpProfile(Enj_ProfilerData *d, FILE *f){
+    size_t bytes = 0;
+    size_t i;
+
+    for(i = 0; i < d->capacity; i++){
+        if(d->samples[i].p) bytes += d->samples[i].size;
+    }
+
+    fprintf(f, "heap profile: %lu: %lu [%lu: %lu] @ heap_v2/%lu\n",
+        (unsigned long)d->live, (unsigned long)bytes,
+        (unsigned long)d->live, (unsigned long)bytes,
+        (unsigned long)d->rate);
+
+    for(i = 0; i < d->capacity; i++){
+        Enj_ProfileSample *s = &d->samples[i];
+        int j;
+
+        if(!s->p) continue;
+
+        fprintf(f, "1: %lu [1: %lu] @",
+            (unsigned long)s->size, (unsigned long)s->size);
+        for(j = 0; j < s->depth; j++){
+            fprintf(f, " %p", s->stack[j]);
+        }
+        fputc('\n', f);
+    }
+
+#ifdef __linux__
+    /*Mappings let pprof symbolize the addresses*/
+    {
+        FILE *maps = fopen("/proc/self/maps", "r");
+        if(maps){
+            char line[512];
+            fputs("\nMAPPED_LIBRARIES:\n", f);
+            while(fgets(line, sizeof(line), maps)) fputs(line, f);
+            fclose(maps);
+        }
+    }
+#endif
+}
+
+static void * prof_acate(size_t size, void *data){
+    Enj_ProfilerData *prof = (Enj_ProfilerData *)data;
+    void *res = Enj_Alloc(prof->backing, size);
+
+    prof_sample(prof, res, size, prof->allocskip);
+    return res;
+}
+static void * prof_zacate(size_t size, void *data){
+    Enj_ProfilerData *prof = (Enj_ProfilerData *)data;
+    void *res = Enj_Calloc(prof->backing, size);
+
+    prof_sample(prof, res, size, prof->callocskip);
+    return res;
+}
+static void prof_decate(void *p, void *data){
+    Enj_ProfilerData *prof = (Enj_ProfilerData *)data;
+
+    if(prof->live && p) prof_forget(prof, p);
+    Enj_Free(prof->backing, p);
+}
+
+
+
+/*Snapshots*/
+
+/*Descriptor size of a, with start, size and extent of the buffer in*/
+/*use according to data and the offset of fresh, 0 if a is not supported*/
+static size_t snapshot_desc(
+    Enj_Allocator *a,
+    void *data,
+    char **start,
+    size_t *size,
+    size_t *extent,
+    int *inbuffer,
+    size_t *fresh){
+
+    if(a->alloc == &bump_acate){
+        Enj_BumpAllocatorData *d = (Enj_BumpAllocatorData *)data;
+        *fresh = offsetof(Enj_BumpAllocatorData, fresh);
+        *start = (char *)d->start;
+        *size = d->size;
+        *extent = (size_t)((char *)d->head - *start);
+        *inbuffer = 0;
+        return sizeof(*d);
+    }
+    if(a->alloc == &stack_acate){
+        Enj_StackAllocatorData *d = (Enj_StackAllocatorData *)data;
+        *fresh = offsetof(Enj_StackAllocatorData, fresh);
+        *start = (char *)d->start;
+        *size = d->size;
+        *extent = (size_t)((char *)d->head - *start);
+        *inbuffer = 0;
+        return sizeof(*d);
+    }
+    if(a->alloc == &pool_acate){
+        /*Chunks past carve hold no free list links*/
+        Enj_PoolAllocatorData *d = (Enj_PoolAllocatorData *)data;
+        *fresh = offsetof(Enj_PoolAllocatorData, fresh);
+        *start = (char *)d->start;
+        *size = d->size;
+        *extent = (size_t)((char *)d->carve - *start);
+        *inbuffer = 1;
+        return sizeof(*d);
+    }
+    if(a->alloc == &heap_acate){
+        Enj_HeapAllocatorData *d = (Enj_HeapAllocatorData *)data;
+        *fresh = offsetof(Enj_HeapAllocatorData, fresh);
+        *start = (char *)d->start;
+        *size = d->size;
+        *extent = d->size;
+        *inbuffer = 1;
+        return sizeof(*d);
+    }
+    return 0;
+}
+
+#ifdef ENJ_HAVE_MMAP
+/*Map the file over the arena, MAP_PRIVATE also drops copied pages*/
+static int cow_map(Enj_CowArena *c, int flags){
+    if(mmap(c->start, c->size, PROT_READ | PROT_WRITE,
+        flags | MAP_FIXED, c->fd, 0) == MAP_FAILED) return -1;
+    return 0;
+}
+
+static int cow_write(Enj_CowArena *c, size_t off, size_t len){
+    while(len){
+        ssize_t n = pwrite(c->fd, (char *)c->start + off, len, (off_t)off);
+        if(n <= 0) return -1;
+        off += (size_t)n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/*Write pages copied since the snapshot back to the file*/
+static int cow_writeback(Enj_CowArena *c){
+#ifdef __linux__
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t pages = c->size / page;
+    size_t first = (size_t)c->start / page;
+    size_t run = 0;
+    size_t i;
+    int inrun = 0;
+    int fd = open("/proc/self/pagemap", O_RDONLY);
+
+    if(fd >= 0){
+        uint64_t entries[512];
+
+        for(i = 0; i < pages; i++){
+            uint64_t e;
+            int copied;
+
+            if(i % 512 == 0){
+                size_t n = pages - i < 512 ? pages - i : 512;
+                if(pread(fd, entries, n * sizeof(uint64_t),
+                    (off_t)((first + i) * sizeof(uint64_t)))
+                    != (ssize_t)(n * sizeof(uint64_t))){
+                    close(fd);
+                    return cow_write(c, 0, c->size);
+                }
+            }
+
+            /*Present or swapped, and not a page of the file: a private copy*/
+            e = entries[i % 512];
+            copied = (int)((e >> 63 | e >> 62) & 1) & (int)(~e >> 61 & 1);
+
+            if(copied && !inrun){
+                run = i;
+                inrun = 1;
+            }
+            else if(!copied && inrun){
+                inrun = 0;
+                if(cow_write(c, run * page, (i - run) * page)){
+                    close(fd);
+                    return -1;
+                }
+            }
+        }
+        close(fd);
+
+        if(inrun) return cow_write(c, run * page, (pages - run) * page);
+        return 0;
+    }
+#endif
+    /*No way to tell copied pages apart, write everything*/
+    return cow_write(c, 0, c->size);
+}
+
+void * Enj_CreateCowArena(Enj_CowArena *c, size_t size){
+    void *p;
+
+    size = ROUNDUP(size, (size_t)sysconf(_SC_PAGESIZE));
+
+    c->start = NULL;
+    c->size = size;
+    c->fd = -1;
+    c->snapshot = 0;
+    c->generation = 0;
+
+#ifdef MFD_CLOEXEC
+    c->fd = memfd_create("enj_arena", MFD_CLOEXEC);
+#endif
+    if(c->fd < 0){
+        FILE *f = tmpfile();
+        if(!f) return NULL;
+        c->fd = dup(fileno(f));
+        fclose(f);
+        if(c->fd < 0) return NULL;
+    }
+
+    /*Sparse, only pages written take up space*/
+    if(ftruncate(c->fd, (off_t)size)){
+        Enj_DestroyCowArena(c);
+        return NULL;
+    }
+
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, c->fd, 0);
+    if(p == MAP_FAILED){
+        Enj_DestroyCowArena(c);
+        return NULL;
+    }
+
+    c->start = p;
+    return p;
+}
+
+void Enj_DestroyCowArena(Enj_CowArena *c){
+    if(c->start) munmap(c->start, c->size);
+    if(c->fd >= 0) close(c->fd);
+
+    c->start = NULL;
+    c->size = 0;
+    c->fd = -1;
+    c->snapshot = 0;
+}
+#endif
+
+int Enj_Snapshot(Enj_Allocator *a, Enj_ArenaSnapshot *s){
+    char *start;
+    size_t size;
+    size_t extent;
+    int inbuffer;
+    size_t fresh;
+    size_t n = snapshot_desc(
+        a, a->data, &start, &size, &extent, &inbuffer, &fresh);
+
+    if(!n) return -1;
+
+#ifdef ENJ_HAVE_MMAP
+    if(s->cow){
+        Enj_CowArena *c = s->cow;
+
+        /*Only the arena's own memory rolls back*/
+        if(!c->start || start < (char *)c->start
+        || (size_t)(start - (char *)c->start) > c->size
+        || size > c->size - (size_t)(start - (char *)c->start)){
+            return -1;
+        }
+
+        /*A snapshot already held is folded into the file first,*/
+        /*which leaves it nothing to roll back to*/
+        if(c->snapshot && cow_writeback(c)) return -1;
+        if(cow_map(c, MAP_PRIVATE)) return -1;
+        c->snapshot = 1;
+        c->generation++;
+
+        memcpy(&s->data, a->data, n);
+        s->generation = c->generation;
+        return 0;
+    }
+#endif
+    if(s->copy){
+        memcpy(s->copy, start, extent);
+    }
+    else if(inbuffer){
+        return -1;
+    }
+
+    memcpy(&s->data, a->data, n);
+    return 0;
+}
+
+int Enj_Restore(Enj_Allocator *a, Enj_ArenaSnapshot *s){
+    char *start;
+    size_t size;
+    size_t extent;
+    int inbuffer;
+    size_t fresh;
+    size_t n = snapshot_desc(
+        a, &s->data, &start, &size, &extent, &inbuffer, &fresh);
+
+    void **livefresh;
+    void *used;
+
+    if(!n) return -1;
+
+#ifdef ENJ_HAVE_MMAP
+    if(s->cow){
+        /*Whole arena goes back, including memory that was still fresh*/
+        if(!s->cow->snapshot || s->generation != s->cow->generation
+        || cow_map(s->cow, MAP_PRIVATE)) return -1;
+        memcpy(a->data, &s->data, n);
+        return 0;
+    }
+#endif
+    if(s->copy){
+        memcpy(start, s->copy, extent);
+    }
+    else if(inbuffer){
+        return -1;
+    }
+
+    /*Memory handed out since the snapshot is not zero anymore*/
+    livefresh = (void **)((char *)a->data + fresh);
+    used = *livefresh;
+    memcpy(a->data, &s->data, n);
+    if((char *)used > (char *)*livefresh) *livefresh = used;
+
+    return 0;
+}
+
+int Enj_CommitSnapshot(Enj_ArenaSnapshot *s){
+#ifdef ENJ_HAVE_MMAP
+    if(s->cow && s->cow->snapshot){
+        /*An older snapshot was already folded into the file*/
+        if(s->generation != s->cow->generation) return -1;
+        if(cow_writeback(s->cow) || cow_map(s->cow, MAP_SHARED)) return -1;
+        s->cow->snapshot = 0;
+    }
+#endif
+    /*Copies and descriptors need nothing to keep the current state*/
+    return 0;
+}
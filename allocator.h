@@ -1,5 +1,10 @@
 #pragma once
 #include <stddef.h>
+#include <stdio.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define ENJ_HAVE_MMAP 1
+#endif
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -14,29 +19,171 @@ typedef struct Enj_BumpAllocatorData{
     void *start;
     size_t size;
     void *head;
+
+    /*Never handed out past here, see Enj_Calloc*/
+    void *fresh;
 } Enj_BumpAllocatorData;
 typedef struct Enj_StackAllocatorData{
     void *start;
     size_t size;
     void *head;
+
+    /*Never handed out past here, see Enj_Calloc*/
+    void *fresh;
 } Enj_StackAllocatorData;
+typedef struct Enj_VirtualAllocatorData{
+    void *start;
+    size_t size;
+    void *head;
+
+    /*Pages below committed are readable and writable*/
+    void *committed;
+    size_t commitsize;
+    int flags;
+
+    /*Never handed out past here, see Enj_Calloc*/
+    void *fresh;
+} Enj_VirtualAllocatorData;
+typedef struct Enj_RingAllocatorData{
+    void *start;
+    size_t size;
+
+    /*Allocations advance head, frees reclaim from tail*/
+    void *head;
+    void *tail;
+
+    /*Never handed out past here, see Enj_Calloc*/
+    void *fresh;
+} Enj_RingAllocatorData;
 typedef struct Enj_PoolAllocatorData{
     void *start;
     size_t size;
     size_t chunksize;
 
     void *free;
+    /*Chunks from carve on have not been handed out yet*/
+    void *carve;
+
+    /*Never handed out past here, see Enj_Calloc*/
+    void *fresh;
 } Enj_PoolAllocatorData;
+typedef struct Enj_BitmapPoolAllocatorData{
+    void *start;
+    size_t size;
+    size_t chunksize;
+
+    /*One bit per chunk, set while the chunk is live*/
+    unsigned long *bitmap;
+    size_t count;
+    /*Lowest bitmap word that may contain a free chunk*/
+    size_t hint;
+
+    /*Never handed out past here, see Enj_Calloc*/
+    void *fresh;
+} Enj_BitmapPoolAllocatorData;
 typedef struct Enj_HeapAllocatorData{
     void *start;
     size_t size;
 
     void *root;
+
+    /*Never handed out past here, see Enj_Calloc*/
+    void *fresh;
 } Enj_HeapAllocatorData;
 
+/*Maximum number of block orders in a buddy allocator*/
+#define ENJ_BUDDY_ORDERS 32
+
+typedef struct Enj_BuddyAllocatorData{
+    void *start;
+    size_t size;
+    size_t minsize;
+
+    /*Blocks are carved from base, metadata sits before it*/
+    void *base;
+    size_t units;
+    int shift;
+    int orders;
+
+    /*Order of each allocated block, indexed by its first unit*/
+    unsigned char *order;
+    /*Bit per block of each order, set while the block is free*/
+    unsigned long *bitmap;
+    size_t bitoffset[ENJ_BUDDY_ORDERS];
+
+    void *free[ENJ_BUDDY_ORDERS];
+    /*Bit k set while free[k] is non-empty*/
+    unsigned long avail;
+
+    /*Never handed out past here, see Enj_Calloc*/
+    void *fresh;
+} Enj_BuddyAllocatorData;
+
+typedef struct Enj_CowArena{
+    void *start;
+    size_t size;
+    /*File backing the arena, mapped shared normally and privately*/
+    /*while a snapshot is held, so the file keeps the snapshot*/
+    int fd;
+    int snapshot;
+    /*Bumped by every snapshot, only the latest one can be restored*/
+    unsigned long generation;
+} Enj_CowArena;
+
+typedef struct Enj_ArenaSnapshot{
+    /*Copy of the allocator descriptor*/
+    union{
+        Enj_BumpAllocatorData bump;
+        Enj_StackAllocatorData stack;
+        Enj_PoolAllocatorData pool;
+        Enj_HeapAllocatorData heap;
+    } data;
+
+    /*Set at most one of these before Enj_Snapshot to also save buffer*/
+    /*contents, copy must hold the allocator's whole buffer*/
+    void *copy;
+    Enj_CowArena *cow;
+    unsigned long generation;
+} Enj_ArenaSnapshot;
+
+/*Maximum frames kept per sampled allocation*/
+#define ENJ_PROFILE_DEPTH 16
+
+typedef struct Enj_ProfileSample{
+    void *p;
+    size_t size;
+    int depth;
+    void *stack[ENJ_PROFILE_DEPTH];
+} Enj_ProfileSample;
+typedef struct Enj_ProfilerData{
+    Enj_Allocator *backing;
+
+    /*Mean bytes between samples, 0 disables sampling*/
+    size_t rate;
+    size_t countdown;
+    unsigned long rng;
+
+    /*Hash table of live sampled blocks*/
+    Enj_ProfileSample *samples;
+    size_t capacity;
+    size_t live;
+
+    /*Profiler frames above the caller of Enj_Alloc and Enj_Calloc*/
+    int allocskip;
+    int callocskip;
+} Enj_ProfilerData;
+
 void * Enj_Alloc(Enj_Allocator *a, size_t size);
 void Enj_Free(Enj_Allocator *a, void *p);
 
+/*Zeroed allocation. Allocators track fresh, the address past which*/
+/*nothing has been handed out, and return memory past it without*/
+/*clearing. Init sets it to the end of the buffer, see Enj_MarkZeroed*/
+void * Enj_Calloc(Enj_Allocator *a, size_t size);
+/*Tells a its buffer is all zero, e.g. fresh mmap pages or a cow arena,*/
+/*so Enj_Calloc skips clearing it. Call right after init*/
+void Enj_MarkZeroed(Enj_Allocator *a);
+
 
 void Enj_InitBumpAllocator(
     Enj_Allocator *a,
@@ -50,6 +197,40 @@ void Enj_InitStackAllocator(
     void *buffer,
     size_t size);
 
+#ifdef ENJ_HAVE_MMAP
+/*Flags for virtual allocators*/
+#define ENJ_VIRTUAL_HUGEPAGES 1
+
+/*Bump and stack allocators over a reserved address range of size bytes*/
+/*Pages are committed commitsize bytes at a time as head grows*/
+/*On failure to reserve, start is NULL and every allocation fails*/
+void Enj_InitVirtualBumpAllocator(
+    Enj_Allocator *a,
+    Enj_VirtualAllocatorData *d,
+    size_t size,
+    size_t commitsize,
+    int flags);
+
+void Enj_InitVirtualStackAllocator(
+    Enj_Allocator *a,
+    Enj_VirtualAllocatorData *d,
+    size_t size,
+    size_t commitsize,
+    int flags);
+
+/*Frees every allocation and returns pages to the system*/
+void Enj_ResetVirtualAllocator(Enj_VirtualAllocatorData *d);
+/*Releases the reserved range*/
+void Enj_DestroyVirtualAllocator(Enj_VirtualAllocatorData *d);
+#endif
+
+/*FIFO allocator, out of order frees are reclaimed once tail reaches them*/
+void Enj_InitRingAllocator(
+    Enj_Allocator *a,
+    Enj_RingAllocatorData *d,
+    void *buffer,
+    size_t size);
+
 void Enj_InitPoolAllocator(
     Enj_Allocator *a,
     Enj_PoolAllocatorData *d,
@@ -57,12 +238,73 @@ void Enj_InitPoolAllocator(
     size_t size,
     size_t chunksize);
 
+/*Pool whose occupancy lives in a bitmap at the end of buffer,*/
+/*so freeing a chunk never writes to the chunk itself*/
+void Enj_InitBitmapPoolAllocator(
+    Enj_Allocator *a,
+    Enj_BitmapPoolAllocatorData *d,
+    void *buffer,
+    size_t size,
+    size_t chunksize);
+
+/*Calls fn(chunk, ctx) for every live chunk in address order*/
+/*fn may free the chunk it is given*/
+void Enj_PoolForEachLive(
+    Enj_BitmapPoolAllocatorData *d,
+    void (*fn)(void *, void *),
+    void *ctx);
+
 void Enj_InitHeapAllocator(
     Enj_Allocator *a,
     Enj_HeapAllocatorData *d,
     void *buffer,
     size_t size);
 
+/*Power of two blocks from minsize up, minsize is rounded up to a power of two*/
+void Enj_InitBuddyAllocator(
+    Enj_Allocator *a,
+    Enj_BuddyAllocatorData *d,
+    void *buffer,
+    size_t size,
+    size_t minsize);
+
+/*Saves the state of a bump, stack, pool or heap allocator, 0 on success*/
+/*With neither copy nor cow set only the descriptor is saved, which*/
+/*rolls back bump and stack allocations but not the memory they hold;*/
+/*pool and heap keep state in their buffer and fail without one*/
+int Enj_Snapshot(Enj_Allocator *a, Enj_ArenaSnapshot *s);
+/*Rolls a back to the state s was taken at, 0 on success*/
+/*The snapshot stays valid, so a can be rolled back again, except that*/
+/*a newer snapshot on the same cow arena replaces it*/
+int Enj_Restore(Enj_Allocator *a, Enj_ArenaSnapshot *s);
+/*Keeps everything done since the snapshot and releases it, 0 on success*/
+int Enj_CommitSnapshot(Enj_ArenaSnapshot *s);
+
+#ifdef ENJ_HAVE_MMAP
+/*Buffer of size bytes, zero filled, for use as an allocator's buffer*/
+/*with Enj_MarkZeroed.*/
+/*Taking a snapshot copies nothing; pages are copied on first write*/
+/*after it, a restore drops the copies and a commit writes back only*/
+/*those, so each costs the pages touched. NULL on failure*/
+void * Enj_CreateCowArena(Enj_CowArena *c, size_t size);
+void Enj_DestroyCowArena(Enj_CowArena *c);
+#endif
+
+/*Wraps backing, sampling about one allocation per rate bytes*/
+/*Sampled blocks live in samples until freed, capacity entries at most*/
+void Enj_InitProfiler(
+    Enj_Allocator *a,
+    Enj_ProfilerData *d,
+    Enj_Allocator *backing,
+    Enj_ProfileSample *samples,
+    size_t capacity,
+    size_t rate);
+
+void Enj_SetProfilerRate(Enj_ProfilerData *d, size_t rate);
+
+/*Writes live sampled blocks in pprof legacy heap_v2 text format*/
+void Enj_DumpProfile(Enj_ProfilerData *d, FILE *f);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,173 @@
+#pragma once
+/*C++20 coroutine frames allocated from an Enj_Allocator*/
+#include <cstddef>
+#include <memory>
+#include <new>
+#include "allocator.h"
+
+/*g++ only pairs a template operator new with a template operator delete,*/
+/*but frames are always freed by the usual one, so at -O0 it flags every*/
+/*coroutine using the allocator_arg_t overloads below. It reports this*/
+/*in the coroutine, so push and pop around this header would not help*/
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+namespace Enj{
+
+/*Arena for frames of coroutines not handed one explicitly,*/
+/*NULL falls back to global operator new*/
+inline thread_local Enj_Allocator *current_arena = nullptr;
+
+/*Binds an arena as current_arena for the lifetime of the scope*/
+class ArenaScope{
+public:
+    explicit ArenaScope(Enj_Allocator *a) : prev(current_arena){
+        current_arena = a;
+    }
+    ~ArenaScope(){
+        current_arena = prev;
+    }
+    ArenaScope(const ArenaScope &) = delete;
+    ArenaScope &operator=(const ArenaScope &) = delete;
+
+private:
+    Enj_Allocator *prev;
+};
+
+namespace detail{
+    /*Frames are prefixed with the allocator that owns them*/
+    constexpr std::size_t frame_header = alignof(std::max_align_t);
+
+    inline void *frame_alloc(Enj_Allocator *a, std::size_t n){
+        char *p;
+
+        if(!a){
+            p = static_cast<char *>(::operator new(n + frame_header));
+        }
+        else{
+            p = static_cast<char *>(Enj_Alloc(a, n + frame_header));
+            if(!p) throw std::bad_alloc();
+        }
+
+        *reinterpret_cast<Enj_Allocator **>(p) = a;
+        return p + frame_header;
+    }
+
+    inline void frame_free(void *frame){
+        char *p = static_cast<char *>(frame) - frame_header;
+        Enj_Allocator *a = *reinterpret_cast<Enj_Allocator **>(p);
+
+        if(!a) ::operator delete(p);
+        else Enj_Free(a, p);
+    }
+}
+
+/*Base for promise_type. Coroutines whose parameters start with*/
+/*(std::allocator_arg_t, Enj_Allocator *), after the object for member*/
+/*coroutines, take their frame from that arena, others from current_arena*/
+struct ArenaPromise{
+    template<class... Args>
+    static void *operator new(
+        std::size_t n, std::allocator_arg_t, Enj_Allocator *a, Args &&...){
+        return detail::frame_alloc(a, n);
+    }
+    template<class Self, class... Args>
+    static void *operator new(
+        std::size_t n, Self &&, std::allocator_arg_t, Enj_Allocator *a,
+        Args &&...){
+        return detail::frame_alloc(a, n);
+    }
+    static void *operator new(std::size_t n){
+        return detail::frame_alloc(current_arena, n);
+    }
+
+    static void operator delete(void *p, std::size_t){
+        detail::frame_free(p);
+    }
+};
+
+/*Enj_Allocator keeping a pool per frame size class. All pools share*/
+/*one region taken from backing on first use, so a free finds its pool*/
+/*by address. Sizes above the largest class, or a pool running dry,*/
+/*fall back to backing*/
+class FramePoolCache{
+public:
+    static constexpr std::size_t granule = 64;
+    static constexpr std::size_t classes = 16;
+
+    /*slab is the bytes of each class pool, rounded up so every pool*/
+    /*starts aligned*/
+    FramePoolCache(Enj_Allocator *backing, std::size_t slab)
+        : backing(backing),
+        slab((slab + alignof(std::max_align_t) - 1)
+            / alignof(std::max_align_t) * alignof(std::max_align_t)),
+        region(nullptr), failed(false){
+        self.alloc = &acate;
+        self.dealloc = &decate;
+        self.data = this;
+    }
+    ~FramePoolCache(){
+        if(region) Enj_Free(backing, region);
+    }
+    FramePoolCache(const FramePoolCache &) = delete;
+    FramePoolCache &operator=(const FramePoolCache &) = delete;
+
+    Enj_Allocator *allocator(){
+        return &self;
+    }
+
+private:
+    static void *acate(std::size_t size, void *data){
+        FramePoolCache *cache = static_cast<FramePoolCache *>(data);
+        std::size_t c = (size + granule - 1) / granule;
+        void *res;
+
+        if(!cache->region && (cache->failed || !cache->init())) c = 0;
+
+        if(c && c <= classes){
+            res = Enj_Alloc(&cache->pools[c - 1], c * granule);
+            if(res) return res;
+        }
+        return Enj_Alloc(cache->backing, size);
+    }
+    static void decate(void *p, void *data){
+        FramePoolCache *cache = static_cast<FramePoolCache *>(data);
+        char *c = static_cast<char *>(p);
+
+        if(cache->region
+        && c >= cache->region && c < cache->region + classes * cache->slab){
+            Enj_Free(&cache->pools[(c - cache->region) / cache->slab], p);
+        }
+        else Enj_Free(cache->backing, p);
+    }
+
+    bool init(){
+        std::size_t i;
+
+        region = static_cast<char *>(Enj_Alloc(backing, classes * slab));
+        /*Do not ask backing again on every allocation*/
+        if(!region){
+            failed = true;
+            return false;
+        }
+
+        /*Pools carve lazily, so this does not touch the region*/
+        for(i = 0; i < classes; i++){
+            Enj_InitPoolAllocator(&pools[i], &pooldata[i],
+                region + i * slab, slab, (i + 1) * granule);
+        }
+        return true;
+    }
+
+    Enj_Allocator self;
+    Enj_Allocator *backing;
+    std::size_t slab;
+
+    char *region;
+    bool failed;
+    Enj_Allocator pools[classes];
+    Enj_PoolAllocatorData pooldata[classes];
+};
+
+}
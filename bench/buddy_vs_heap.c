@@ -0,0 +1,63 @@
+/*Buddy against heap allocator on a power of two trace*/
+/*Random alloc/free over a set of slots, sizes 4 KiB to 1 MiB. About*/
+/*half the slots are live at ~230 KiB each, the arena leaves enough*/
+/*room that neither allocator times failing requests*/
+#include "../allocator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SLOTS 4096
+#define OPS 4000000L
+#define ARENA ((size_t)1 << 30)
+
+static void *slots[SLOTS];
+
+static double run(Enj_Allocator *a, long *fails){
+    clock_t c = clock();
+    long i;
+
+    srand(7);
+    memset(slots, 0, sizeof(slots));
+    *fails = 0;
+
+    for(i = 0; i < OPS; i++){
+        int s = rand() % SLOTS;
+        if(slots[s]){
+            Enj_Free(a, slots[s]);
+            slots[s] = NULL;
+        }
+        else{
+            slots[s] = Enj_Alloc(a, (size_t)4096 << (rand() % 9));
+            if(!slots[s]) (*fails)++;
+        }
+    }
+    for(i = 0; i < SLOTS; i++){
+        if(slots[i]) Enj_Free(a, slots[i]);
+    }
+
+    return (double)(clock() - c) / CLOCKS_PER_SEC;
+}
+
+int main(void){
+    Enj_Allocator a;
+    Enj_BuddyAllocatorData buddy;
+    Enj_HeapAllocatorData heap;
+    void *buffer = malloc(ARENA);
+    double t;
+    long fails;
+
+    if(!buffer) return 1;
+
+    Enj_InitBuddyAllocator(&a, &buddy, buffer, ARENA, 4096);
+    t = run(&a, &fails);
+    printf("buddy %.3fs, %ld failed allocations\n", t, fails);
+
+    Enj_InitHeapAllocator(&a, &heap, buffer, ARENA);
+    t = run(&a, &fails);
+    printf("heap  %.3fs, %ld failed allocations\n", t, fails);
+
+    free(buffer);
+    return 0;
+}
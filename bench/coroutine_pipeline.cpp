@@ -0,0 +1,128 @@
+/*Coroutine pipeline with frames from the default allocator against*/
+/*frames from Enj allocators. Each run creates three nested frames*/
+#include "../allocator_coroutine.hpp"
+#include <chrono>
+#include <coroutine>
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+/*Lazily started task resuming its awaiter on completion*/
+template<class Base>
+struct Task{
+    struct promise_type : Base{
+        int value;
+        std::coroutine_handle<> cont;
+
+        Task get_return_object(){
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept{
+            return {};
+        }
+        struct Final{
+            bool await_ready() noexcept{
+                return false;
+            }
+            std::coroutine_handle<> await_suspend(
+                std::coroutine_handle<promise_type> h) noexcept{
+                std::coroutine_handle<> c = h.promise().cont;
+                if(c) return c;
+                return std::noop_coroutine();
+            }
+            void await_resume() noexcept{}
+        };
+        Final final_suspend() noexcept{
+            return {};
+        }
+        void return_value(int v){
+            value = v;
+        }
+        void unhandled_exception(){
+            std::abort();
+        }
+    };
+
+    explicit Task(std::coroutine_handle<promise_type> h) : h(h){}
+    Task(Task &&o) : h(std::exchange(o.h, {})){}
+    ~Task(){
+        if(h) h.destroy();
+    }
+
+    bool await_ready(){
+        return false;
+    }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> c){
+        h.promise().cont = c;
+        return h;
+    }
+    int await_resume(){
+        return h.promise().value;
+    }
+    int run(){
+        h.resume();
+        return h.promise().value;
+    }
+
+    std::coroutine_handle<promise_type> h;
+};
+
+struct DefaultPromise{};
+
+template<class B> Task<B> source(int x){
+    char pad[100];
+    pad[x & 63] = 1;
+    co_return x + pad[x & 63];
+}
+template<class B> Task<B> scale(int x){
+    co_return 2 * co_await source<B>(x);
+}
+template<class B> Task<B> sink(int x){
+    co_return 1 + co_await scale<B>(x);
+}
+
+template<class B> double run(long n){
+    std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+    volatile long sum = 0;
+    long i;
+
+    for(i = 0; i < n; i++){
+        Task<B> task = sink<B>(static_cast<int>(i));
+        sum = sum + task.run();
+    }
+
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - t).count();
+}
+
+int main(){
+    const long n = 5000000;
+    std::vector<char> heapbuf(64 << 20);
+    std::vector<char> stackbuf(1 << 20);
+
+    Enj_Allocator heap;
+    Enj_HeapAllocatorData heapdata;
+    Enj_Allocator stack;
+    Enj_StackAllocatorData stackdata;
+
+    Enj_InitHeapAllocator(&heap, &heapdata, heapbuf.data(), heapbuf.size());
+    Enj_InitStackAllocator(&stack, &stackdata, stackbuf.data(), stackbuf.size());
+
+    std::printf("default new      %.3fs\n", run<DefaultPromise>(n));
+    {
+        Enj::FramePoolCache cache(&heap, 1 << 16);
+        Enj::ArenaScope scope(cache.allocator());
+        std::printf("frame pool cache %.3fs\n", run<Enj::ArenaPromise>(n));
+    }
+    {
+        Enj::ArenaScope scope(&stack);
+        std::printf("stack arena      %.3fs\n", run<Enj::ArenaPromise>(n));
+    }
+    {
+        Enj::ArenaScope scope(&heap);
+        std::printf("heap arena       %.3fs\n", run<Enj::ArenaPromise>(n));
+    }
+
+    return 0;
+}